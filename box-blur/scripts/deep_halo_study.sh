@@ -0,0 +1,72 @@
+#!/bin/bash
+
+# Deep Halo vs Per-Pass Halo Study
+# Runs an iterated MPI blur with one halo exchange per pass and with a single deep halo exchange
+
+if [ $# -eq 0 ]; then
+    echo "Usage: $0 <input_image.jpg> [iterations] [process counts...]"
+    echo ""
+    echo "Example: $0 photo.jpg 3 4 8 16"
+    exit 1
+fi
+
+INPUT_IMAGE=$1
+ITERATIONS=${2:-3}
+PROCESS_COUNTS=${*:3}
+PROCESS_COUNTS=${PROCESS_COUNTS:-"4 8 16"}
+NUM_RUNS=3
+
+if [ ! -f "$INPUT_IMAGE" ]; then
+    echo "Error: Image '$INPUT_IMAGE' not found!"
+    exit 1
+fi
+
+if [ ! -f "./mpi_box_blur" ]; then
+    echo "Error: mpi_box_blur not found (run 'make mpi' to build)"
+    exit 1
+fi
+
+mkdir -p results/benchmark_outputs
+CSV_FILE="results/deep_halo_study.csv"
+echo "Processes,Iterations,Halo,Time(s),Pixels,Speed(Mpx/s)" > $CSV_FILE
+
+extract_time() {
+    grep -i "^time:" | sed 's/.*: //' | sed 's/ seconds//' | head -1
+}
+
+extract_pixels() {
+    grep -i "^pixels" | sed 's/.*: //' | head -1
+}
+
+echo "======================================"
+echo "  Deep Halo vs Per-Pass Halo Study"
+echo "======================================"
+echo "Input image: $INPUT_IMAGE"
+echo "Iterations: $ITERATIONS"
+echo ""
+
+for PROCS in $PROCESS_COUNTS; do
+    for HALO in per-pass deep; do
+        FLAGS="--iterations $ITERATIONS"
+        if [ "$HALO" = "deep" ]; then
+            FLAGS="$FLAGS --deep-halo"
+        fi
+        echo "  $PROCS process(es), $HALO halo..."
+
+        TOTAL_TIME=0
+        for RUN in $(seq 1 $NUM_RUNS); do
+            OUTPUT=$(mpirun -np $PROCS ./mpi_box_blur "$INPUT_IMAGE" \
+                results/benchmark_outputs/iterated_${PROCS}p_${HALO}.jpg $FLAGS 2>&1)
+            TIME=$(echo "$OUTPUT" | extract_time)
+            TOTAL_TIME=$(echo "$TOTAL_TIME + $TIME" | bc)
+        done
+        AVG_TIME=$(echo "scale=6; $TOTAL_TIME / $NUM_RUNS" | bc)
+        PIXELS=$(echo "$OUTPUT" | extract_pixels)
+        SPEED=$(echo "scale=2; $PIXELS / ($AVG_TIME * 1000000)" | bc)
+        echo "$PROCS,$ITERATIONS,$HALO,$AVG_TIME,$PIXELS,$SPEED" >> $CSV_FILE
+        echo "    Average time: ${AVG_TIME}s (over $NUM_RUNS runs)"
+    done
+done
+
+echo ""
+echo "Results saved to $CSV_FILE"
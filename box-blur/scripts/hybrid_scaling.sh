@@ -0,0 +1,69 @@
+#!/bin/bash
+
+# Hybrid MPI + OpenMP Scaling Study
+# Runs mpi_hybrid_box_blur for every ranks x threads split of the available cores
+
+if [ $# -eq 0 ]; then
+    echo "Usage: $0 <input_image.jpg> [total_cores]"
+    echo ""
+    echo "Example: $0 photo.jpg 8"
+    exit 1
+fi
+
+INPUT_IMAGE=$1
+TOTAL_CORES=${2:-$(nproc)}
+NUM_RUNS=3
+
+if [ ! -f "$INPUT_IMAGE" ]; then
+    echo "Error: Image '$INPUT_IMAGE' not found!"
+    exit 1
+fi
+
+if [ ! -f "./mpi_hybrid_box_blur" ]; then
+    echo "Error: mpi_hybrid_box_blur not found (run 'make hybrid' to build)"
+    exit 1
+fi
+
+mkdir -p results/benchmark_outputs
+CSV_FILE="results/hybrid_scaling.csv"
+echo "Ranks,Threads,Cores,Time(s),Pixels,Speed(Mpx/s)" > $CSV_FILE
+
+extract_time() {
+    grep -i "^time:" | sed 's/.*: //' | sed 's/ seconds//' | head -1
+}
+
+extract_pixels() {
+    grep -i "^pixels" | sed 's/.*: //' | head -1
+}
+
+echo "======================================"
+echo "  Hybrid MPI + OpenMP Scaling Study"
+echo "======================================"
+echo "Input image: $INPUT_IMAGE"
+echo "Cores: $TOTAL_CORES"
+echo ""
+
+# Every divisor of the core count gives one ranks x threads combination
+for RANKS in $(seq 1 $TOTAL_CORES); do
+    if [ $((TOTAL_CORES % RANKS)) -ne 0 ]; then
+        continue
+    fi
+    THREADS=$((TOTAL_CORES / RANKS))
+    echo "  $RANKS rank(s) x $THREADS thread(s)..."
+
+    TOTAL_TIME=0
+    for RUN in $(seq 1 $NUM_RUNS); do
+        OUTPUT=$(OMP_NUM_THREADS=$THREADS mpirun -np $RANKS -x OMP_NUM_THREADS --bind-to none \
+            ./mpi_hybrid_box_blur "$INPUT_IMAGE" results/benchmark_outputs/hybrid_${RANKS}p_${THREADS}t.jpg 2>&1)
+        TIME=$(echo "$OUTPUT" | extract_time)
+        TOTAL_TIME=$(echo "$TOTAL_TIME + $TIME" | bc)
+    done
+    AVG_TIME=$(echo "scale=6; $TOTAL_TIME / $NUM_RUNS" | bc)
+    PIXELS=$(echo "$OUTPUT" | extract_pixels)
+    SPEED=$(echo "scale=2; $PIXELS / ($AVG_TIME * 1000000)" | bc)
+    echo "$RANKS,$THREADS,$TOTAL_CORES,$AVG_TIME,$PIXELS,$SPEED" >> $CSV_FILE
+    echo "    Average time: ${AVG_TIME}s (over $NUM_RUNS runs)"
+done
+
+echo ""
+echo "Results saved to $CSV_FILE"
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# OpenCL Kernel Variant Comparison
+# Runs opencl_box_blur with every --kernel variant on the same image (e.g. on PoCL for a CPU device)
+
+if [ $# -eq 0 ]; then
+    echo "Usage: $0 <input_image.jpg> [variants...]"
+    echo ""
+    echo "Example: $0 photo.jpg naive tiled separable image sat"
+    exit 1
+fi
+
+INPUT_IMAGE=$1
+VARIANTS=${*:2}
+VARIANTS=${VARIANTS:-"naive tiled separable image sat"}
+NUM_RUNS=3
+
+if [ ! -f "$INPUT_IMAGE" ]; then
+    echo "Error: Image '$INPUT_IMAGE' not found!"
+    exit 1
+fi
+
+if [ ! -f "./opencl_box_blur" ]; then
+    echo "Error: opencl_box_blur not found (run 'make opencl' to build)"
+    exit 1
+fi
+
+mkdir -p results/benchmark_outputs
+CSV_FILE="results/opencl_kernels.csv"
+echo "Kernel,Time(s),Pixels,Speed(Mpx/s)" > $CSV_FILE
+
+extract_time() {
+    grep -i "^time:" | sed 's/.*: //' | sed 's/ seconds//' | head -1
+}
+
+extract_pixels() {
+    grep -i "^pixels" | sed 's/.*: //' | head -1
+}
+
+echo "======================================"
+echo "  OpenCL Kernel Variant Comparison"
+echo "======================================"
+echo "Input image: $INPUT_IMAGE"
+echo ""
+
+for VARIANT in $VARIANTS; do
+    echo "  Kernel: $VARIANT..."
+
+    TOTAL_TIME=0
+    for RUN in $(seq 1 $NUM_RUNS); do
+        OUTPUT=$(./opencl_box_blur "$INPUT_IMAGE" results/benchmark_outputs/opencl_${VARIANT}.jpg --kernel $VARIANT 2>&1)
+        TIME=$(echo "$OUTPUT" | extract_time)
+        TOTAL_TIME=$(echo "$TOTAL_TIME + $TIME" | bc)
+    done
+    AVG_TIME=$(echo "scale=6; $TOTAL_TIME / $NUM_RUNS" | bc)
+    PIXELS=$(echo "$OUTPUT" | extract_pixels)
+    SPEED=$(echo "scale=2; $PIXELS / ($AVG_TIME * 1000000)" | bc)
+    echo "$VARIANT,$AVG_TIME,$PIXELS,$SPEED" >> $CSV_FILE
+    echo "    Average time: ${AVG_TIME}s (over $NUM_RUNS runs)"
+done
+
+echo ""
+echo "Results saved to $CSV_FILE"
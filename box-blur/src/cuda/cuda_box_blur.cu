@@ -24,7 +24,7 @@ __global__ void box_blur_kernel(const unsigned char *input, unsigned char *outpu
                     int iy = y + ky;
                     
                     if (ix >= 0 && ix < width && iy >= 0 && iy < height) {
-                        int src_idx = (iy * width + ix) * channels + (channels == 1 ? 0 : c);
+                        int src_idx = (iy * width + ix) * channels + (channels < 3 ? 0 : c);
                         sum += input[src_idx];
                         count++;
                     }
@@ -2,17 +2,74 @@
 #include <stdlib.h>
 #include <string.h>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include "image_io.h"
 
-// Blur three channels; input may be 1-channel or 3+/4-channel. Only RGB channels are processed; alpha is ignored.
-void apply_box_blur_mpi(const unsigned char *input, unsigned char *output_rgb, int width, int height, int channels, int kernel_size, int start_row, int end_row) {
+// Interior rows blurred between two polls of the non-blocking halo exchange
+#define POLL_ROWS 8
+
+// Synthetic rows blurred per calibration round, and the minimum calibration time per rank
+#define CALIBRATION_ROWS 16
+#define CALIBRATION_SECONDS 0.05
+
+// Run-time options shared by all ranks
+typedef struct {
+    int overlap;    // overlap the halo exchange with interior rows (row slabs only)
+    int mpiio_in;   // every rank reads its own slab of a PGM/PPM input with MPI-IO
+    int mpiio_out;  // every rank writes its own rows of a PPM output with MPI-IO
+    int decomp_2d;  // 2D Cartesian blocks instead of row slabs
+    int calibrate;  // size row slabs by each rank's measured throughput
+    int bcast_compressed;  // broadcast the encoded file and decode on every rank (row slabs only)
+    int shared_node;       // one shared input/output buffer per node instead of per rank
+    int iterations;        // number of blur passes (row slabs only)
+    int deep_halo;         // exchange one iterations-deep halo instead of one halo per pass
+    int frames;            // frames blurred back to back (row slabs only)
+    int persistent;        // reuse persistent halo requests and buffers across frames
+} BlurOptions;
+
+// Per-rank measurements of one distributed blur
+typedef struct {
+    double elapsed;          // distribution + halo exchange + compute + collection
+    double distribute_time;  // scatter of the slab, or broadcast of the encoded file
+    double decode_time;      // per-rank decode of the broadcast file
+    long long distribute_bytes;  // input bytes this rank received from root
+    double halo_time;        // from starting the halo exchange until it completed
+    double exposed_time;     // time spent blocked on the halo exchange
+    double compute_time;
+    double barrier_time;     // time spent waiting in barriers and window fences
+    double gather_time;      // collection of the output on root
+    double read_time, write_time;
+    double load_time, save_time;  // root decode of the input and encode of the output
+    long long read_bytes, write_bytes;
+    long long halo_bytes;    // halo bytes received by this rank
+    int halo_rounds;         // halo exchanges this rank took part in
+    int node_leader;         // shared-node mode: this rank owns its node's windows
+    long long window_bytes;  // shared-node mode: bytes this rank allocated in shared windows
+    long long slab_bytes;    // shared-node mode: bytes a private slab of this rank would need
+    int write_ok;
+} RankStats;
+
+// Blur the block [x0, x1) x [y0, y1) of the image. Only RGB channels are processed; alpha is ignored.
+// `input` is a tile whose first element is global pixel (in_x0, in_y0) with `in_stride` pixels per row;
+// `output_rgb` is a 3-channel tile starting at global pixel (out_x0, out_y0) with `out_stride` pixels per row.
+void apply_box_blur_tile(const unsigned char *input, int in_x0, int in_y0, int in_stride,
+                         unsigned char *output_rgb, int out_x0, int out_y0, int out_stride,
+                         int width, int height, int channels, int kernel_size,
+                         int x0, int x1, int y0, int y1) {
     int k_offset = kernel_size / 2;
 
-    for (int y = start_row; y < end_row; y++) {
-        for (int x = 0; x < width; x++) {
+    // Hybrid build: the rank's threads share its block (MPI is only called outside this loop)
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2)
+#endif
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
             for (int c = 0; c < 3; c++) {
                 int sum = 0;
                 int count = 0;
@@ -22,58 +79,1429 @@ void apply_box_blur_mpi(const unsigned char *input, unsigned char *output_rgb, i
                         int nx = x + n;
                         int ny = y + m;
                         if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
-                            int src_idx = (ny * width + nx) * channels + (channels == 1 ? 0 : c);
+                            size_t src_idx = ((size_t)(ny - in_y0) * in_stride + (nx - in_x0)) * channels + (channels < 3 ? 0 : c);
                             sum += input[src_idx];
                             count++;
                         }
                     }
                 }
 
-                int local_y = y - start_row;
-                int dst_idx = (local_y * width + x) * 3 + c;
+                size_t dst_idx = ((size_t)(y - out_y0) * out_stride + (x - out_x0)) * 3 + c;
                 output_rgb[dst_idx] = (unsigned char)(sum / count);
             }
         }
     }
 }
 
+// Blur full-width rows [start_row, end_row). `input` holds image rows starting at global row `input_row0`
+// (the local slab plus its halo rows), `output_rgb` holds rows starting at global row `output_row0`.
+void apply_box_blur_mpi(const unsigned char *input, int input_row0, unsigned char *output_rgb, int output_row0,
+                        int width, int height, int channels, int kernel_size, int start_row, int end_row) {
+    apply_box_blur_tile(input, 0, input_row0, width, output_rgb, 0, output_row0, width,
+                        width, height, channels, kernel_size, 0, width, start_row, end_row);
+}
+
+// Split `height` rows into contiguous slabs, one per rank; the last rank takes the remainder.
+void partition_rows(int height, int size, int *row_starts, int *row_counts) {
+    int rows_per_process = height / size;
+    for (int i = 0; i < size; i++) {
+        row_starts[i] = i * rows_per_process;
+        row_counts[i] = (i == size - 1) ? height - row_starts[i] : rows_per_process;
+    }
+}
+
+// Split rows in proportion to `weights` (e.g. measured rows/sec), giving every rank at least `min_rows`.
+void partition_rows_weighted(int height, int size, const double *weights, int min_rows,
+                             int *row_starts, int *row_counts) {
+    double total = 0.0;
+    for (int i = 0; i < size; i++) total += weights[i];
+    if (!(total > 0.0)) {
+        partition_rows(height, size, row_starts, row_counts);
+        return;
+    }
+
+    double cumulative = 0.0;
+    int start = 0;
+    for (int i = 0; i < size; i++) {
+        cumulative += weights[i];
+        int end = (i == size - 1) ? height : (int)(height * cumulative / total + 0.5);
+        row_starts[i] = start;
+        row_counts[i] = end - start;
+        start = end;
+    }
+
+    // Top up slabs that are too thin to supply a halo with rows from the largest slab
+    for (int i = 0; i < size; i++) {
+        while (row_counts[i] < min_rows) {
+            int largest = 0;
+            for (int j = 1; j < size; j++) {
+                if (row_counts[j] > row_counts[largest]) largest = j;
+            }
+            if (row_counts[largest] <= min_rows) break;
+            row_counts[largest]--;
+            row_counts[i]++;
+        }
+    }
+
+    start = 0;
+    for (int i = 0; i < size; i++) {
+        row_starts[i] = start;
+        start += row_counts[i];
+    }
+}
+
+// Split `height` rows over only as many ranks as can each supply a `min_rows` halo to their neighbours;
+// the surplus ranks of a short image get no rows. Slabs follow `weights` when given, otherwise they are
+// equal. Returns the number of ranks that hold rows.
+int partition_slabs(int height, int size, const double *weights, int min_rows, int *row_starts, int *row_counts) {
+    int active = (min_rows > 0) ? height / min_rows : size;
+    if (active > size) active = size;
+    if (active < 1) active = 1;
+    if (weights) {
+        partition_rows_weighted(height, active, weights, min_rows, row_starts, row_counts);
+    } else {
+        partition_rows(height, active, row_starts, row_counts);
+    }
+    for (int i = active; i < size; i++) {
+        row_starts[i] = height;
+        row_counts[i] = 0;
+    }
+    return active;
+}
+
+// Slowest rank's time over the average when rank i blurs row_counts[i] rows at speeds[i] rows/sec
+double predicted_imbalance(const int *row_counts, const double *speeds, int size) {
+    double max_time = 0.0, sum_time = 0.0;
+    for (int i = 0; i < size; i++) {
+        double t = row_counts[i] / speeds[i];
+        if (t > max_time) max_time = t;
+        sum_time += t;
+    }
+    return (sum_time > 0.0) ? max_time / (sum_time / size) : 1.0;
+}
+
+// Rows per second this rank blurs on a synthetic strip as wide as the image
+double calibrate_throughput(int width, int channels, int kernel_size) {
+    int k_offset = kernel_size / 2;
+    size_t row_bytes = (size_t)width * channels;
+    unsigned char *strip = (unsigned char*)malloc((CALIBRATION_ROWS + 2 * k_offset) * row_bytes);
+    unsigned char *strip_out = (unsigned char*)malloc((size_t)CALIBRATION_ROWS * width * 3);
+    if (!strip || !strip_out) {
+        free(strip);
+        free(strip_out);
+        return 1.0;
+    }
+    for (size_t i = 0; i < (CALIBRATION_ROWS + 2 * k_offset) * row_bytes; i++) {
+        strip[i] = (unsigned char)(i * 31);
+    }
+
+    long rows_done = 0;
+    double start_time = MPI_Wtime(), elapsed;
+    do {
+        apply_box_blur_mpi(strip, 0, strip_out, k_offset, width, CALIBRATION_ROWS + 2 * k_offset, channels,
+                           kernel_size, k_offset, k_offset + CALIBRATION_ROWS);
+        rows_done += CALIBRATION_ROWS;
+        elapsed = MPI_Wtime() - start_time;
+    } while (elapsed < CALIBRATION_SECONDS);
+
+    free(strip);
+    free(strip_out);
+    return rows_done / elapsed;
+}
+
+// Read a whole file into memory (for broadcasting the encoded image). Returns NULL on failure.
+unsigned char *read_file_bytes(const char *filename, long *file_size) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char *bytes = (unsigned char*)malloc(*file_size > 0 ? *file_size : 1);
+    if (bytes && fread(bytes, 1, *file_size, file) != (size_t)*file_size) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    return bytes;
+}
+
+int has_extension(const char *filename, const char *ext) {
+    const char *dot = strrchr(filename, '.');
+    return dot && strcmp(dot, ext) == 0;
+}
+
+// Write 3-channel RGB pixels, picking the format from the file extension. Returns non-zero on success.
+int write_output(const char *filename, const unsigned char *rgb, int width, int height) {
+    if (strstr(filename, ".png")) return stbi_write_png(filename, width, height, 3, rgb, width*3);
+    if (strstr(filename, ".jpg")) return stbi_write_jpg(filename, width, height, 3, rgb, 90);
+    if (has_extension(filename, ".ppm")) return write_ppm(filename, rgb, width, height) == 0;
+    return stbi_write_bmp(filename, width, height, 3, rgb);
+}
+
+// Swap halo rows with the ranks above and below. `slab` starts with `halo_top` halo rows,
+// followed by `my_rows` owned rows and `halo_bottom` halo rows. Counts are in rows of `row_type`
+// (`row_bytes` bytes each) so they stay small however wide the image is. Only the first `size` ranks
+// hold rows; ranks beyond them have no neighbours.
+void exchange_halos(unsigned char *slab, MPI_Datatype row_type, size_t row_bytes, int halo_top, int my_rows,
+                    int halo_bottom, int rank, int size, MPI_Comm comm) {
+    int up = (rank > 0 && rank < size) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+    unsigned char *owned = slab + halo_top * row_bytes;
+
+    // Our first rows become the bottom halo of the rank above; receive our bottom halo from below
+    MPI_Sendrecv(owned, halo_top, row_type, up, 0,
+                 owned + my_rows * row_bytes, halo_bottom, row_type, down, 0,
+                 comm, MPI_STATUS_IGNORE);
+
+    // Our last rows become the top halo of the rank below; receive our top halo from above
+    MPI_Sendrecv(owned + (my_rows - halo_bottom) * row_bytes, halo_bottom, row_type, down, 1,
+                 slab, halo_top, row_type, up, 1,
+                 comm, MPI_STATUS_IGNORE);
+}
+
+// Non-blocking variant of exchange_halos: posts the receives into the halo rows and the sends of the
+// boundary rows, leaving the four requests in `reqs` for the caller to complete.
+void start_halo_exchange(unsigned char *slab, MPI_Datatype row_type, size_t row_bytes, int halo_top, int my_rows,
+                         int halo_bottom, int rank, int size, MPI_Comm comm, MPI_Request reqs[4]) {
+    int up = (rank > 0 && rank < size) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+    unsigned char *owned = slab + halo_top * row_bytes;
+
+    MPI_Irecv(slab, halo_top, row_type, up, 1, comm, &reqs[0]);
+    MPI_Irecv(owned + my_rows * row_bytes, halo_bottom, row_type, down, 0, comm, &reqs[1]);
+    MPI_Isend(owned, halo_top, row_type, up, 0, comm, &reqs[2]);
+    MPI_Isend(owned + (my_rows - halo_bottom) * row_bytes, halo_bottom, row_type, down, 1, comm, &reqs[3]);
+}
+
+// Persistent variant of start_halo_exchange: builds the four requests once with MPI_Recv_init/MPI_Send_init
+// so every later exchange on the same slab is just MPI_Startall + MPI_Waitall. Free them with MPI_Request_free.
+void init_halo_exchange(unsigned char *slab, MPI_Datatype row_type, size_t row_bytes, int halo_top, int my_rows,
+                        int halo_bottom, int rank, int size, MPI_Comm comm, MPI_Request reqs[4]) {
+    int up = (rank > 0 && rank < size) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+    unsigned char *owned = slab + halo_top * row_bytes;
+
+    MPI_Recv_init(slab, halo_top, row_type, up, 1, comm, &reqs[0]);
+    MPI_Recv_init(owned + my_rows * row_bytes, halo_bottom, row_type, down, 0, comm, &reqs[1]);
+    MPI_Send_init(owned, halo_top, row_type, up, 0, comm, &reqs[2]);
+    MPI_Send_init(owned + (my_rows - halo_bottom) * row_bytes, halo_bottom, row_type, down, 1, comm, &reqs[3]);
+}
+
+// Send `count` bytes from root in pieces that each fit an int count
+void bcast_bytes(unsigned char *buffer, size_t count, int root, MPI_Comm comm) {
+    const size_t max_piece = (size_t)1 << 30;
+    for (size_t offset = 0; offset < count; offset += max_piece) {
+        size_t piece = (count - offset < max_piece) ? count - offset : max_piece;
+        MPI_Bcast(buffer + offset, (int)piece, MPI_UNSIGNED_CHAR, root, comm);
+    }
+}
+
+// Barrier that adds the time this rank waited in it to `*wait_time`
+void timed_barrier(MPI_Comm comm, double *wait_time) {
+    double wait_start = MPI_Wtime();
+    MPI_Barrier(comm);
+    *wait_time += MPI_Wtime() - wait_start;
+}
+
+// Row-slab decomposition. Root's `input` is scattered as row slabs (or every rank reads its slab with
+// MPI-IO, or decodes root's `encoded` file bytes after a broadcast), halos are swapped with the ranks above and below, and the blurred rows are gathered into
+// root's `output_rgb` (or written by every rank with MPI-IO).
+void blur_row_slabs(const unsigned char *input, unsigned char *output_rgb, int width, int height, int channels,
+                    int kernel_size, long data_offset, const unsigned char *encoded, size_t encoded_size,
+                    const char *input_path, const char *output_path, const BlurOptions *opts, RankStats *stats) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int k_offset = kernel_size / 2;
+
+    // Calculate the row slab owned by each process
+    int *row_starts = (int *)calloc(size, sizeof(int));
+    int *row_counts = (int *)calloc(size, sizeof(int));
+    if (!row_starts || !row_counts) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    int active = partition_slabs(height, size, NULL, k_offset, row_starts, row_counts);
+
+    // Heterogeneous ranks: measure each rank's speed and size the slabs to match
+    if (opts->calibrate && active > 1) {
+        double my_speed = calibrate_throughput(width, channels, kernel_size);
+        double *speeds = (double *)malloc(size * sizeof(double));
+        if (!speeds) {
+            fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        MPI_Allgather(&my_speed, 1, MPI_DOUBLE, speeds, 1, MPI_DOUBLE, MPI_COMM_WORLD);
+
+        double equal_imbalance = predicted_imbalance(row_counts, speeds, active);
+        partition_slabs(height, size, speeds, k_offset, row_starts, row_counts);
+        if (rank == 0) {
+            printf("Calibrated speed (rows/sec):");
+            for (int i = 0; i < size; i++) printf(" %.0f", speeds[i]);
+            printf("\nPredicted imbalance (max/avg): equal rows %.3f, weighted rows %.3f\n",
+                   equal_imbalance, predicted_imbalance(row_counts, speeds, active));
+        }
+        free(speeds);
+    }
+
+    int start_row = row_starts[rank];
+    int my_rows = row_counts[rank];
+    int end_row = start_row + my_rows;
+
+    // Halo rows only come from the direct neighbours, so ranks past the last slab have none
+    int halo_top = (rank > 0 && rank < active) ? k_offset : 0;
+    int halo_bottom = (rank < active - 1) ? k_offset : 0;
+    size_t row_bytes = (size_t)width * channels;
+
+    // Each process only stores its own rows plus the halo rows (one spare byte keeps a rank without rows
+    // from getting a NULL allocation)
+    unsigned char *my_input = NULL;
+    if (!opts->bcast_compressed) {
+        my_input = (unsigned char*)malloc((halo_top + my_rows + halo_bottom) * row_bytes + 1);
+    }
+    unsigned char *my_output = (unsigned char*)malloc((size_t)width * my_rows * 3 + 1);
+    if ((!my_input && !opts->bcast_compressed) || !my_output) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    // Collectives count whole rows so no count or displacement exceeds the image height
+    MPI_Datatype input_row, output_row;
+    MPI_Type_contiguous(width * channels, MPI_UNSIGNED_CHAR, &input_row);
+    MPI_Type_commit(&input_row);
+    MPI_Type_contiguous(width * 3, MPI_UNSIGNED_CHAR, &output_row);
+    MPI_Type_commit(&output_row);
+
+    // Collective read of each slab together with its halo rows, so no scatter or halo exchange is needed
+    if (opts->mpiio_in) {
+        MPI_File fh;
+        if (MPI_File_open(MPI_COMM_WORLD, input_path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+            fprintf(stderr, "Error: Cannot open %s on rank %d\n", input_path, rank);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        MPI_Offset offset = data_offset + (MPI_Offset)(start_row - halo_top) * row_bytes;
+        int count = halo_top + my_rows + halo_bottom;
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        double io_start = MPI_Wtime();
+        MPI_Status status;
+        int rows_read = 0;
+        MPI_File_read_at_all(fh, offset, my_input, count, input_row, &status);
+        MPI_Get_count(&status, input_row, &rows_read);
+        if (rows_read != count) {
+            fprintf(stderr, "Error: short read of %s on rank %d (%d of %d rows)\n", input_path, rank, rows_read, count);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        stats->read_time = MPI_Wtime() - io_start;
+        stats->read_bytes = (long long)count * row_bytes;
+        MPI_File_close(&fh);
+    }
+
+    // Start timing after setup
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    double start_time = MPI_Wtime();
+
+    // Scatter row slabs, then fetch the halo rows from the neighbouring ranks
+    double distribute_start = MPI_Wtime();
+    unsigned char *decoded = NULL;
+    if (opts->bcast_compressed) {
+        // The encoded file is 10-20x smaller than its pixels; every rank decodes its own copy
+        unsigned char *file_bytes = (rank == 0) ? (unsigned char *)encoded : (unsigned char *)malloc(encoded_size);
+        if (!file_bytes) {
+            fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        bcast_bytes(file_bytes, encoded_size, 0, MPI_COMM_WORLD);
+        stats->distribute_time = MPI_Wtime() - distribute_start;
+        stats->distribute_bytes = (rank == 0) ? 0 : encoded_size;
+
+        double decode_start = MPI_Wtime();
+        int w, h, c;
+        decoded = stbi_load_from_memory(file_bytes, (int)encoded_size, &w, &h, &c, 0);
+        if (!decoded || w != width || h != height || c != channels) {
+            fprintf(stderr, "Error: Cannot decode broadcast image on rank %d\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        stats->decode_time = MPI_Wtime() - decode_start;
+        if (rank != 0) free(file_bytes);
+    } else if (!opts->mpiio_in) {
+        MPI_Scatterv(input, row_counts, row_starts, input_row,
+                     my_input + halo_top * row_bytes, my_rows, input_row,
+                     0, MPI_COMM_WORLD);
+        stats->distribute_time = MPI_Wtime() - distribute_start;
+        stats->distribute_bytes = (rank == 0) ? 0 : my_rows * row_bytes;
+        stats->halo_bytes = (halo_top + halo_bottom) * row_bytes;
+    }
+
+    double compute_start = MPI_Wtime();
+
+    if (opts->bcast_compressed) {
+        // The whole image is local, so no halo exchange is needed
+        apply_box_blur_mpi(decoded, 0, my_output, start_row,
+                           width, height, channels, kernel_size, start_row, end_row);
+    } else if (opts->mpiio_in) {
+        // Halo rows were read from the file along with the slab
+        apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                           width, height, channels, kernel_size, start_row, end_row);
+    } else if (opts->overlap) {
+        // Rows whose kernel window stays inside the owned slab do not need any halo data
+        int interior_begin = start_row + halo_top;
+        int interior_end = end_row - halo_bottom;
+        if (interior_begin > interior_end) interior_begin = interior_end = start_row;
+
+        MPI_Request reqs[4];
+        double halo_start = MPI_Wtime();
+        start_halo_exchange(my_input, input_row, row_bytes, halo_top, my_rows, halo_bottom, rank, active,
+                            MPI_COMM_WORLD, reqs);
+
+        // Blur the interior a few rows at a time, polling the exchange so it keeps progressing
+        int halo_done = 0;
+        for (int y = interior_begin; y < interior_end; y += POLL_ROWS) {
+            int chunk_end = (y + POLL_ROWS < interior_end) ? y + POLL_ROWS : interior_end;
+            apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                               width, height, channels, kernel_size, y, chunk_end);
+            if (!halo_done) {
+                MPI_Testall(4, reqs, &halo_done, MPI_STATUSES_IGNORE);
+                if (halo_done) stats->halo_time = MPI_Wtime() - halo_start;
+            }
+        }
+
+        if (!halo_done) {
+            double wait_start = MPI_Wtime();
+            MPI_Waitall(4, reqs, MPI_STATUSES_IGNORE);
+            stats->exposed_time = MPI_Wtime() - wait_start;
+            stats->halo_time = MPI_Wtime() - halo_start;
+        }
+
+        // Boundary rows need the halos
+        apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                           width, height, channels, kernel_size, start_row, interior_begin);
+        apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                           width, height, channels, kernel_size, interior_end, end_row);
+    } else {
+        double halo_start = MPI_Wtime();
+        exchange_halos(my_input, input_row, row_bytes, halo_top, my_rows, halo_bottom, rank, active, MPI_COMM_WORLD);
+        stats->halo_time = stats->exposed_time = MPI_Wtime() - halo_start;
+
+        // Each process works on its assigned rows
+        apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                           width, height, channels, kernel_size, start_row, end_row);
+    }
+
+    stats->compute_time = MPI_Wtime() - compute_start - stats->exposed_time;
+
+    // Gather results back to root
+    if (!opts->mpiio_out) {
+        double gather_start = MPI_Wtime();
+        MPI_Gatherv(my_output, my_rows, output_row,
+                    output_rgb, row_counts, row_starts, output_row,
+                    0, MPI_COMM_WORLD);
+        stats->gather_time = MPI_Wtime() - gather_start;
+    }
+
+    // End timing
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    stats->elapsed = MPI_Wtime() - start_time;
+
+    // Every rank writes its own output rows behind the PPM header
+    stats->write_ok = 1;
+    if (opts->mpiio_out) {
+        char header[64];
+        int header_len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+        MPI_File fh;
+        if (MPI_File_open(MPI_COMM_WORLD, output_path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+            if (rank == 0) fprintf(stderr, "Error: Cannot create %s\n", output_path);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        MPI_File_set_size(fh, header_len + (MPI_Offset)width * height * 3);
+        if (rank == 0) {
+            MPI_File_write_at(fh, 0, header, header_len, MPI_CHAR, MPI_STATUS_IGNORE);
+        }
+        MPI_Offset offset = header_len + (MPI_Offset)start_row * width * 3;
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        double io_start = MPI_Wtime();
+        if (MPI_File_write_at_all(fh, offset, my_output, my_rows, output_row, MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+            stats->write_ok = 0;
+        }
+        stats->write_time = MPI_Wtime() - io_start;
+        stats->write_bytes = (long long)my_rows * width * 3;
+        MPI_File_close(&fh);
+    }
+
+    MPI_Type_free(&input_row);
+    MPI_Type_free(&output_row);
+    stbi_image_free(decoded);
+    free(my_input);
+    free(my_output);
+    free(row_starts);
+    free(row_counts);
+}
+
+// Blur the image `iterations` times over row slabs. Per-pass mode exchanges kernel_size / 2 halo rows before
+// every pass; deep-halo mode exchanges iterations * (kernel_size / 2) rows once and then runs all passes
+// locally, each pass producing a valid region kernel_size / 2 rows narrower than the one before.
+void blur_iterated_slabs(const unsigned char *input, unsigned char *output_rgb, int width, int height, int channels,
+                         int kernel_size, int iterations, int deep_halo, RankStats *stats) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int k_offset = kernel_size / 2;
+    int depth = deep_halo ? iterations * k_offset : k_offset;
+
+    int *row_starts = (int *)calloc(size, sizeof(int));
+    int *row_counts = (int *)calloc(size, sizeof(int));
+    if (!row_starts || !row_counts) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    // The deep halo still comes only from the direct neighbours, so their slabs must be at least that tall
+    int active = partition_slabs(height, size, NULL, depth, row_starts, row_counts);
+
+    int start_row = row_starts[rank];
+    int my_rows = row_counts[rank];
+    int end_row = start_row + my_rows;
+
+    int halo_top = (rank > 0 && rank < active) ? depth : 0;
+    int halo_bottom = (rank < active - 1) ? depth : 0;
+    int slab_rows = halo_top + my_rows + halo_bottom;
+    int row0 = start_row - halo_top;
+    size_t row_bytes = (size_t)width * channels;
+    size_t rgb_row_bytes = (size_t)width * 3;
+
+    // Input slab, then two RGB slabs that the passes alternate between
+    unsigned char *my_input = (unsigned char *)malloc(slab_rows * row_bytes + 1);
+    unsigned char *buffers[2];
+    buffers[0] = (unsigned char *)malloc(slab_rows * rgb_row_bytes + 1);
+    buffers[1] = (unsigned char *)malloc(slab_rows * rgb_row_bytes + 1);
+    if (!my_input || !buffers[0] || !buffers[1]) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    MPI_Datatype input_row, output_row;
+    MPI_Type_contiguous(width * channels, MPI_UNSIGNED_CHAR, &input_row);
+    MPI_Type_commit(&input_row);
+    MPI_Type_contiguous(width * 3, MPI_UNSIGNED_CHAR, &output_row);
+    MPI_Type_commit(&output_row);
+
+    // Start timing after setup
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    double start_time = MPI_Wtime();
+
+    double distribute_start = MPI_Wtime();
+    MPI_Scatterv(input, row_counts, row_starts, input_row,
+                 my_input + halo_top * row_bytes, my_rows, input_row,
+                 0, MPI_COMM_WORLD);
+    stats->distribute_time = MPI_Wtime() - distribute_start;
+    stats->distribute_bytes = (rank == 0) ? 0 : (long long)my_rows * row_bytes;
+
+    const unsigned char *source = my_input;
+    int source_channels = channels;
+    for (int pass = 1; pass <= iterations; pass++) {
+        if (pass == 1 || !deep_halo) {
+            MPI_Datatype row_type = (pass == 1) ? input_row : output_row;
+            size_t bytes = (pass == 1) ? row_bytes : rgb_row_bytes;
+            double halo_start = MPI_Wtime();
+            exchange_halos((unsigned char *)source, row_type, bytes, halo_top, my_rows, halo_bottom,
+                           rank, active, MPI_COMM_WORLD);
+            stats->halo_time += MPI_Wtime() - halo_start;
+            stats->halo_bytes += (long long)(halo_top + halo_bottom) * bytes;
+            stats->halo_rounds++;
+        }
+
+        // Rows still needed by later passes; beyond the image edge there is nothing to compute
+        int extend = deep_halo ? (iterations - pass) * k_offset : 0;
+        int y0 = (halo_top > 0) ? start_row - extend : start_row;
+        int y1 = (halo_bottom > 0) ? end_row + extend : end_row;
+
+        unsigned char *target = buffers[pass % 2];
+        double compute_start = MPI_Wtime();
+        apply_box_blur_mpi(source, row0, target, row0, width, height, source_channels, kernel_size, y0, y1);
+        stats->compute_time += MPI_Wtime() - compute_start;
+
+        source = target;
+        source_channels = 3;
+    }
+    stats->exposed_time = stats->halo_time;
+
+    double gather_start = MPI_Wtime();
+    MPI_Gatherv(source + halo_top * rgb_row_bytes, my_rows, output_row,
+                output_rgb, row_counts, row_starts, output_row,
+                0, MPI_COMM_WORLD);
+    stats->gather_time = MPI_Wtime() - gather_start;
+
+    // End timing
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    stats->elapsed = MPI_Wtime() - start_time;
+    stats->write_ok = 1;
+
+    MPI_Type_free(&input_row);
+    MPI_Type_free(&output_row);
+    free(my_input);
+    free(buffers[0]);
+    free(buffers[1]);
+    free(row_starts);
+    free(row_counts);
+}
+
+// Blur `frames` same-sized frames over row slabs (the input image is streamed `frames` times). With
+// `persistent` the slabs, row datatypes and halo requests are set up once and reused for every frame;
+// otherwise each frame allocates its slabs, commits its datatypes and posts fresh Isend/Irecv requests.
+void blur_frames(const unsigned char *input, unsigned char *output_rgb, int width, int height, int channels,
+                 int kernel_size, int frames, int persistent, RankStats *stats) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int k_offset = kernel_size / 2;
+
+    int *row_starts = (int *)calloc(size, sizeof(int));
+    int *row_counts = (int *)calloc(size, sizeof(int));
+    if (!row_starts || !row_counts) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    int active = partition_slabs(height, size, NULL, k_offset, row_starts, row_counts);
+
+    int start_row = row_starts[rank];
+    int my_rows = row_counts[rank];
+    int end_row = start_row + my_rows;
+
+    int halo_top = (rank > 0 && rank < active) ? k_offset : 0;
+    int halo_bottom = (rank < active - 1) ? k_offset : 0;
+    size_t row_bytes = (size_t)width * channels;
+    size_t input_bytes = (halo_top + my_rows + halo_bottom) * row_bytes + 1;
+    size_t output_bytes = (size_t)width * my_rows * 3 + 1;
+
+    // Rows whose kernel window stays inside the owned slab are blurred while the halos are in flight
+    int interior_begin = start_row + halo_top;
+    int interior_end = end_row - halo_bottom;
+    if (interior_begin > interior_end) interior_begin = interior_end = start_row;
+
+    unsigned char *my_input = NULL, *my_output = NULL;
+    MPI_Datatype input_row, output_row;
+    MPI_Request reqs[4];
+
+    // Start timing after setup
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    double start_time = MPI_Wtime();
+
+    for (int frame = 0; frame < frames; frame++) {
+        if (!persistent || frame == 0) {
+            my_input = (unsigned char *)malloc(input_bytes);
+            my_output = (unsigned char *)malloc(output_bytes);
+            if (!my_input || !my_output) {
+                fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+            MPI_Type_contiguous(width * channels, MPI_UNSIGNED_CHAR, &input_row);
+            MPI_Type_commit(&input_row);
+            MPI_Type_contiguous(width * 3, MPI_UNSIGNED_CHAR, &output_row);
+            MPI_Type_commit(&output_row);
+            if (persistent) {
+                init_halo_exchange(my_input, input_row, row_bytes, halo_top, my_rows, halo_bottom, rank, active,
+                                   MPI_COMM_WORLD, reqs);
+            }
+        }
+
+        double distribute_start = MPI_Wtime();
+        MPI_Scatterv(input, row_counts, row_starts, input_row,
+                     my_input + halo_top * row_bytes, my_rows, input_row,
+                     0, MPI_COMM_WORLD);
+        stats->distribute_time += MPI_Wtime() - distribute_start;
+        stats->distribute_bytes += (rank == 0) ? 0 : my_rows * row_bytes;
+
+        double halo_start = MPI_Wtime();
+        if (persistent) {
+            MPI_Startall(4, reqs);
+        } else {
+            start_halo_exchange(my_input, input_row, row_bytes, halo_top, my_rows, halo_bottom, rank, active,
+                                MPI_COMM_WORLD, reqs);
+        }
+
+        double compute_start = MPI_Wtime();
+        apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                           width, height, channels, kernel_size, interior_begin, interior_end);
+
+        double wait_start = MPI_Wtime();
+        MPI_Waitall(4, reqs, MPI_STATUSES_IGNORE);
+        double wait_time = MPI_Wtime() - wait_start;
+        stats->exposed_time += wait_time;
+        stats->halo_time += MPI_Wtime() - halo_start;
+        stats->halo_bytes += (halo_top + halo_bottom) * row_bytes;
+        stats->halo_rounds++;
+
+        apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                           width, height, channels, kernel_size, start_row, interior_begin);
+        apply_box_blur_mpi(my_input, start_row - halo_top, my_output, start_row,
+                           width, height, channels, kernel_size, interior_end, end_row);
+        stats->compute_time += MPI_Wtime() - compute_start - wait_time;
+
+        double gather_start = MPI_Wtime();
+        MPI_Gatherv(my_output, my_rows, output_row,
+                    output_rgb, row_counts, row_starts, output_row,
+                    0, MPI_COMM_WORLD);
+        stats->gather_time += MPI_Wtime() - gather_start;
+
+        if (!persistent || frame == frames - 1) {
+            if (persistent) {
+                for (int i = 0; i < 4; i++) MPI_Request_free(&reqs[i]);
+            }
+            MPI_Type_free(&input_row);
+            MPI_Type_free(&output_row);
+            free(my_input);
+            free(my_output);
+        }
+    }
+
+    // End timing
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    stats->elapsed = MPI_Wtime() - start_time;
+    stats->write_ok = 1;
+
+    free(row_starts);
+    free(row_counts);
+}
+
+// Subarray datatype selecting a `rows` x `cols` pixel block at (`y0`, `x0`) of an image that is
+// `height` x `width` pixels with `channels` bytes per pixel
+MPI_Datatype create_block_type(int height, int width, int channels, int rows, int cols, int y0, int x0) {
+    int sizes[2] = { height, width * channels };
+    int subsizes[2] = { rows, cols * channels };
+    int starts[2] = { y0, x0 * channels };
+    MPI_Datatype block;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_UNSIGNED_CHAR, &block);
+    MPI_Type_commit(&block);
+    return block;
+}
+
+// 2D block decomposition over a Cartesian process grid. Root's `input` is scattered as tiles with subarray
+// datatypes, halos are swapped with the four neighbours and the blurred tiles are gathered into root's
+// `output_rgb`. Column halos are exchanged first; the row exchange then carries the full tile width
+// including those halo columns, which fills in the corners without diagonal messages.
+void blur_2d_blocks(const unsigned char *input, unsigned char *output_rgb, int width, int height, int channels,
+                    int kernel_size, RankStats *stats) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int k_offset = kernel_size / 2;
+
+    // Put the larger factor of the process grid along the longer image side
+    int dims[2] = { 0, 0 };
+    MPI_Dims_create(size, 2, dims);
+    if (width > height) {
+        int tmp = dims[0];
+        dims[0] = dims[1];
+        dims[1] = tmp;
+    }
+    int grid_rows = dims[0], grid_cols = dims[1];
+
+    if ((grid_rows > 1 && height / grid_rows < k_offset) || (grid_cols > 1 && width / grid_cols < k_offset)) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: %dx%d image cannot be split into a %dx%d grid with a %dx%d kernel.\n",
+                    width, height, grid_cols, grid_rows, kernel_size, kernel_size);
+        }
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    // Keep world ranks so root is still rank 0 in the grid
+    int periods[2] = { 0, 0 };
+    MPI_Comm cart;
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &cart);
+
+    int *row_starts = (int *)malloc(grid_rows * sizeof(int));
+    int *row_counts = (int *)malloc(grid_rows * sizeof(int));
+    int *col_starts = (int *)malloc(grid_cols * sizeof(int));
+    int *col_counts = (int *)malloc(grid_cols * sizeof(int));
+    if (!row_starts || !row_counts || !col_starts || !col_counts) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    partition_rows(height, grid_rows, row_starts, row_counts);
+    partition_rows(width, grid_cols, col_starts, col_counts);
+
+    int coords[2];
+    MPI_Cart_coords(cart, rank, 2, coords);
+    int up, down, left, right;
+    MPI_Cart_shift(cart, 0, 1, &up, &down);
+    MPI_Cart_shift(cart, 1, 1, &left, &right);
+
+    int y0 = row_starts[coords[0]], tile_h = row_counts[coords[0]];
+    int x0 = col_starts[coords[1]], tile_w = col_counts[coords[1]];
+    int halo_top = (up != MPI_PROC_NULL) ? k_offset : 0;
+    int halo_bottom = (down != MPI_PROC_NULL) ? k_offset : 0;
+    int halo_left = (left != MPI_PROC_NULL) ? k_offset : 0;
+    int halo_right = (right != MPI_PROC_NULL) ? k_offset : 0;
+    int local_w = halo_left + tile_w + halo_right;
+    int local_h = halo_top + tile_h + halo_bottom;
+
+    unsigned char *my_input = (unsigned char*)malloc((size_t)local_w * local_h * channels);
+    unsigned char *my_output = (unsigned char*)malloc((size_t)tile_w * tile_h * 3);
+    MPI_Request *reqs = (MPI_Request *)malloc(size * sizeof(MPI_Request));
+    MPI_Datatype *types = (MPI_Datatype *)malloc(size * sizeof(MPI_Datatype));
+    if (!my_input || !my_output || !reqs || !types) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    // Owned block inside the local tile, and the halo strips exchanged with the neighbours
+    MPI_Datatype owned_type = create_block_type(local_h, local_w, channels, tile_h, tile_w, halo_top, halo_left);
+    MPI_Datatype column_halo, row_halo;
+    MPI_Type_vector(tile_h, k_offset * channels, local_w * channels, MPI_UNSIGNED_CHAR, &column_halo);
+    MPI_Type_commit(&column_halo);
+    MPI_Type_vector(k_offset, local_w * channels, local_w * channels, MPI_UNSIGNED_CHAR, &row_halo);
+    MPI_Type_commit(&row_halo);
+
+    // Start timing after setup
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    double start_time = MPI_Wtime();
+
+    // Root sends every rank its block straight out of the full image
+    double distribute_start = MPI_Wtime();
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            int rc[2];
+            MPI_Cart_coords(cart, r, 2, rc);
+            types[r] = create_block_type(height, width, channels, row_counts[rc[0]], col_counts[rc[1]],
+                                         row_starts[rc[0]], col_starts[rc[1]]);
+            MPI_Isend(input, 1, types[r], r, 0, cart, &reqs[r]);
+        }
+    }
+    MPI_Recv(my_input, 1, owned_type, 0, 0, cart, MPI_STATUS_IGNORE);
+    if (rank == 0) {
+        MPI_Waitall(size, reqs, MPI_STATUSES_IGNORE);
+        for (int r = 0; r < size; r++) MPI_Type_free(&types[r]);
+    }
+    stats->distribute_time = MPI_Wtime() - distribute_start;
+
+    double halo_start = MPI_Wtime();
+    size_t pixel_row = (size_t)local_w * channels;
+    unsigned char *owned = my_input + halo_top * pixel_row + halo_left * channels;
+
+    // Phase 1: column halos of the owned rows
+    MPI_Sendrecv(owned, 1, column_halo, left, 0,
+                 owned + tile_w * channels, 1, column_halo, right, 0,
+                 cart, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(owned + (tile_w - k_offset) * channels, 1, column_halo, right, 1,
+                 owned - halo_left * channels, 1, column_halo, left, 1,
+                 cart, MPI_STATUS_IGNORE);
+
+    // Phase 2: full-width row halos, which now include the corner pixels
+    MPI_Sendrecv(my_input + halo_top * pixel_row, 1, row_halo, up, 2,
+                 my_input + (halo_top + tile_h) * pixel_row, 1, row_halo, down, 2,
+                 cart, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(my_input + (halo_top + tile_h - k_offset) * pixel_row, 1, row_halo, down, 3,
+                 my_input, 1, row_halo, up, 3,
+                 cart, MPI_STATUS_IGNORE);
+
+    stats->halo_time = stats->exposed_time = MPI_Wtime() - halo_start;
+    stats->halo_bytes = ((long long)(halo_left + halo_right) * tile_h + (long long)(halo_top + halo_bottom) * local_w) * channels;
+
+    double compute_start = MPI_Wtime();
+    apply_box_blur_tile(my_input, x0 - halo_left, y0 - halo_top, local_w, my_output, x0, y0, tile_w,
+                        width, height, channels, kernel_size, x0, x0 + tile_w, y0, y0 + tile_h);
+    stats->compute_time = MPI_Wtime() - compute_start;
+
+    // Root receives every block straight into its place in the output image
+    double gather_start = MPI_Wtime();
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            int rc[2];
+            MPI_Cart_coords(cart, r, 2, rc);
+            types[r] = create_block_type(height, width, 3, row_counts[rc[0]], col_counts[rc[1]],
+                                         row_starts[rc[0]], col_starts[rc[1]]);
+            MPI_Irecv(output_rgb, 1, types[r], r, 1, cart, &reqs[r]);
+        }
+    }
+    MPI_Datatype tile_row;
+    MPI_Type_contiguous(tile_w * 3, MPI_UNSIGNED_CHAR, &tile_row);
+    MPI_Type_commit(&tile_row);
+    MPI_Send(my_output, tile_h, tile_row, 0, 1, cart);
+    MPI_Type_free(&tile_row);
+    if (rank == 0) {
+        MPI_Waitall(size, reqs, MPI_STATUSES_IGNORE);
+        for (int r = 0; r < size; r++) MPI_Type_free(&types[r]);
+    }
+    stats->gather_time = MPI_Wtime() - gather_start;
+
+    // End timing
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    stats->elapsed = MPI_Wtime() - start_time;
+    stats->write_ok = 1;
+
+    if (rank == 0) {
+        printf("Process grid: %d x %d (columns x rows)\n", grid_cols, grid_rows);
+    }
+
+    MPI_Type_free(&owned_type);
+    MPI_Type_free(&column_halo);
+    MPI_Type_free(&row_halo);
+    MPI_Comm_free(&cart);
+    free(my_input);
+    free(my_output);
+    free(reqs);
+    free(types);
+    free(row_starts);
+    free(row_counts);
+    free(col_starts);
+    free(col_counts);
+}
+
+// Node-level shared memory. Ranks on one node (MPI_COMM_TYPE_SHARED) share a single input slab and a single
+// output slab allocated with MPI_Win_allocate_shared. Only the node leaders take part in the scatter, the
+// halo exchange and the gather, so only inter-node traffic goes over the network; the other ranks read
+// and write the node's windows directly.
+void blur_shared_nodes(const unsigned char *input, unsigned char *output_rgb, int width, int height, int channels,
+                       int kernel_size, RankStats *stats) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    int k_offset = kernel_size / 2;
+    size_t row_bytes = (size_t)width * channels;
+
+    MPI_Comm node_comm, leader_comm;
+    int node_rank, node_size;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+
+    // World rank 0 has the lowest key on its node, so it is both a leader and leader rank 0
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+    // Leaders split the rows across nodes in proportion to their rank counts
+    int node_info[4] = { 0, 0, 0, 0 };   // node start row, node rows, halo top, halo bottom
+    int num_nodes = 0, active_nodes = 0, leader_rank = 0;
+    int *node_starts = NULL, *node_counts = NULL;
+    if (leader_comm != MPI_COMM_NULL) {
+        MPI_Comm_rank(leader_comm, &leader_rank);
+        MPI_Comm_size(leader_comm, &num_nodes);
+
+        double my_weight = node_size;
+        double *weights = (double *)malloc(num_nodes * sizeof(double));
+        node_starts = (int *)calloc(num_nodes, sizeof(int));
+        node_counts = (int *)calloc(num_nodes, sizeof(int));
+        if (!weights || !node_starts || !node_counts) {
+            fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        MPI_Allgather(&my_weight, 1, MPI_DOUBLE, weights, 1, MPI_DOUBLE, leader_comm);
+        active_nodes = partition_slabs(height, num_nodes, weights, k_offset, node_starts, node_counts);
+        free(weights);
+
+        node_info[0] = node_starts[leader_rank];
+        node_info[1] = node_counts[leader_rank];
+        node_info[2] = (leader_rank > 0 && leader_rank < active_nodes) ? k_offset : 0;
+        node_info[3] = (leader_rank < active_nodes - 1) ? k_offset : 0;
+    }
+    MPI_Bcast(node_info, 4, MPI_INT, 0, node_comm);
+    int node_start = node_info[0], node_rows = node_info[1];
+    int halo_top = node_info[2], halo_bottom = node_info[3];
+
+    // One input and one output buffer per node, owned by the leader and mapped by every rank on the node
+    MPI_Win input_win, output_win;
+    unsigned char *node_input, *node_output;
+    MPI_Aint input_bytes = (node_rank == 0) ? (MPI_Aint)((halo_top + node_rows + halo_bottom) * row_bytes) : 0;
+    MPI_Aint output_bytes = (node_rank == 0) ? (MPI_Aint)node_rows * width * 3 : 0;
+    MPI_Win_allocate_shared(input_bytes, 1, MPI_INFO_NULL, node_comm, &node_input, &input_win);
+    MPI_Win_allocate_shared(output_bytes, 1, MPI_INFO_NULL, node_comm, &node_output, &output_win);
+    MPI_Aint segment_size;
+    int disp_unit;
+    MPI_Win_shared_query(input_win, 0, &segment_size, &disp_unit, &node_input);
+    MPI_Win_shared_query(output_win, 0, &segment_size, &disp_unit, &node_output);
+
+    // Rows of the node slab handled by this rank
+    int *rank_starts = (int *)calloc(node_size, sizeof(int));
+    int *rank_counts = (int *)calloc(node_size, sizeof(int));
+    if (!rank_starts || !rank_counts) {
+        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    partition_rows(node_rows, node_size, rank_starts, rank_counts);
+    int start_row = node_start + rank_starts[node_rank];
+    int end_row = start_row + rank_counts[node_rank];
+
+    MPI_Datatype input_row, output_row;
+    MPI_Type_contiguous(width * channels, MPI_UNSIGNED_CHAR, &input_row);
+    MPI_Type_commit(&input_row);
+    MPI_Type_contiguous(width * 3, MPI_UNSIGNED_CHAR, &output_row);
+    MPI_Type_commit(&output_row);
+
+    // Start timing after setup
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    double start_time = MPI_Wtime();
+
+    double fence_start = MPI_Wtime();
+    MPI_Win_fence(0, input_win);
+    stats->barrier_time += MPI_Wtime() - fence_start;
+    if (leader_comm != MPI_COMM_NULL) {
+        double distribute_start = MPI_Wtime();
+        MPI_Scatterv(input, node_counts, node_starts, input_row,
+                     node_input + halo_top * row_bytes, node_rows, input_row, 0, leader_comm);
+        stats->distribute_time = MPI_Wtime() - distribute_start;
+        stats->distribute_bytes = (leader_rank == 0) ? 0 : (long long)node_rows * row_bytes;
+
+        double halo_start = MPI_Wtime();
+        exchange_halos(node_input, input_row, row_bytes, halo_top, node_rows, halo_bottom,
+                       leader_rank, active_nodes, leader_comm);
+        stats->halo_time = stats->exposed_time = MPI_Wtime() - halo_start;
+        stats->halo_bytes = (long long)(halo_top + halo_bottom) * row_bytes;
+    }
+    fence_start = MPI_Wtime();
+    MPI_Win_fence(0, input_win);
+    MPI_Win_fence(0, output_win);
+    stats->barrier_time += MPI_Wtime() - fence_start;
+
+    // Every rank on the node blurs its rows straight from and into the shared windows
+    double compute_start = MPI_Wtime();
+    apply_box_blur_mpi(node_input, node_start - halo_top, node_output, node_start,
+                       width, height, channels, kernel_size, start_row, end_row);
+    stats->compute_time = MPI_Wtime() - compute_start;
+    fence_start = MPI_Wtime();
+    MPI_Win_fence(0, output_win);
+    stats->barrier_time += MPI_Wtime() - fence_start;
+
+    if (leader_comm != MPI_COMM_NULL) {
+        double gather_start = MPI_Wtime();
+        MPI_Gatherv(node_output, node_rows, output_row, output_rgb, node_counts, node_starts, output_row,
+                    0, leader_comm);
+        stats->gather_time = MPI_Wtime() - gather_start;
+    }
+
+    // End timing
+    timed_barrier(MPI_COMM_WORLD, &stats->barrier_time);
+    stats->elapsed = MPI_Wtime() - start_time;
+    stats->write_ok = 1;
+
+    // Shared windows hold one slab per node; private slabs would hold one per rank
+    stats->node_leader = (node_rank == 0);
+    stats->window_bytes = (long long)input_bytes + output_bytes;
+    stats->slab_bytes = (long long)(rank_counts[node_rank] + (start_row > 0 ? k_offset : 0) +
+                                    (end_row < height ? k_offset : 0)) * row_bytes +
+                        (long long)rank_counts[node_rank] * width * 3;
+
+    MPI_Type_free(&input_row);
+    MPI_Type_free(&output_row);
+    MPI_Win_free(&input_win);
+    MPI_Win_free(&output_win);
+    if (leader_comm != MPI_COMM_NULL) MPI_Comm_free(&leader_comm);
+    MPI_Comm_free(&node_comm);
+    free(node_starts);
+    free(node_counts);
+    free(rank_starts);
+    free(rank_counts);
+}
+
+// Message tags of the batch master-worker protocol
+#define TAG_REQUEST 10
+#define TAG_WORK 11
+#define TAG_STOP 12
+
+// Decode, blur and encode one image of a batch locally. Returns the number of pixels, or 0 on failure.
+long long blur_image_file(const char *input_path, const char *output_dir, int kernel_size) {
+    int width, height, channels;
+    unsigned char *input = stbi_load(input_path, &width, &height, &channels, 0);
+    if (!input) {
+        fprintf(stderr, "Error: Cannot read %s\n", input_path);
+        return 0;
+    }
+
+    unsigned char *output = (unsigned char*)malloc((size_t)width * height * 3);
+    if (!output) {
+        fprintf(stderr, "Memory allocation failed for %s\n", input_path);
+        stbi_image_free(input);
+        return 0;
+    }
+    apply_box_blur_tile(input, 0, 0, width, output, 0, 0, width,
+                        width, height, channels, kernel_size, 0, width, 0, height);
+
+    const char *base = strrchr(input_path, '/');
+    base = base ? base + 1 : input_path;
+    // Keep the file name; formats we cannot encode (e.g. .pgm, .tga) get a .bmp suffix
+    char output_path[4096];
+    int writable = strstr(base, ".png") || strstr(base, ".jpg") || has_extension(base, ".ppm") || has_extension(base, ".bmp");
+    snprintf(output_path, sizeof(output_path), "%s/%s%s", output_dir, base, writable ? "" : ".bmp");
+
+    int ok = write_output(output_path, output, width, height);
+    if (!ok) fprintf(stderr, "Error writing %s\n", output_path);
+
+    free(output);
+    stbi_image_free(input);
+    return ok ? (long long)width * height : 0;
+}
+
+// Batch mode: rank 0 hands out chunks of file names from `list_path` whenever a worker asks for more,
+// so ranks that get small images or run on faster nodes simply come back more often. With a single
+// process rank 0 works through the list itself.
+void run_batch(const char *list_path, const char *output_dir, int chunk, int kernel_size) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    char **names = NULL;
+    int num_names = 0;
+    if (rank == 0) {
+        FILE *list = fopen(list_path, "r");
+        if (!list) {
+            fprintf(stderr, "Error: Cannot read %s\n", list_path);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        char line[4096];
+        int capacity = 0;
+        while (fgets(line, sizeof(line), list)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0') continue;
+            if (num_names == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                names = (char **)realloc(names, capacity * sizeof(char *));
+                if (!names) {
+                    fprintf(stderr, "Memory allocation failed on root.\n");
+                    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                }
+            }
+            names[num_names++] = strdup(line);
+        }
+        fclose(list);
+
+        printf("=== MPI Box Blur (batch) ===\n");
+        printf("Image list: %s (%d images)\n", list_path, num_names);
+        printf("Output directory: %s\n", output_dir);
+        printf("Processes: %d (%s)\n", size, size > 1 ? "1 master + workers" : "single process");
+        printf("Chunk: %d image(s) per request\n", chunk);
+        printf("Kernel: %dx%d box blur\n", kernel_size, kernel_size);
+        printf("\nProcessing...\n");
+    }
+
+    long long my_images = 0, my_pixels = 0;
+    double busy_time = 0.0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start_time = MPI_Wtime();
+
+    if (size == 1) {
+        double t0 = MPI_Wtime();
+        for (int i = 0; i < num_names; i++) {
+            long long pixels = blur_image_file(names[i], output_dir, kernel_size);
+            if (pixels > 0) {
+                my_images++;
+                my_pixels += pixels;
+            }
+        }
+        busy_time = MPI_Wtime() - t0;
+    } else if (rank == 0) {
+        // Answer work requests until every worker has been told to stop
+        int next = 0, active = size - 1;
+        char *message = NULL;
+        size_t message_capacity = 0;
+        while (active > 0) {
+            MPI_Status status;
+            MPI_Recv(NULL, 0, MPI_CHAR, MPI_ANY_SOURCE, TAG_REQUEST, MPI_COMM_WORLD, &status);
+
+            if (next >= num_names) {
+                MPI_Send(NULL, 0, MPI_CHAR, status.MPI_SOURCE, TAG_STOP, MPI_COMM_WORLD);
+                active--;
+                continue;
+            }
+
+            // Pack up to `chunk` NUL-terminated names into one message
+            size_t length = 0;
+            int last = (next + chunk < num_names) ? next + chunk : num_names;
+            for (int i = next; i < last; i++) length += strlen(names[i]) + 1;
+            if (length > message_capacity) {
+                message_capacity = length;
+                message = (char *)realloc(message, message_capacity);
+                if (!message) {
+                    fprintf(stderr, "Memory allocation failed on root.\n");
+                    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                }
+            }
+            length = 0;
+            for (int i = next; i < last; i++) {
+                strcpy(message + length, names[i]);
+                length += strlen(names[i]) + 1;
+            }
+            next = last;
+            MPI_Send(message, (int)length, MPI_CHAR, status.MPI_SOURCE, TAG_WORK, MPI_COMM_WORLD);
+        }
+        free(message);
+    } else {
+        char *message = NULL;
+        int message_capacity = 0;
+        for (;;) {
+            MPI_Send(NULL, 0, MPI_CHAR, 0, TAG_REQUEST, MPI_COMM_WORLD);
+
+            MPI_Status status;
+            int length;
+            MPI_Probe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_CHAR, &length);
+            if (length > message_capacity) {
+                message_capacity = length;
+                message = (char *)realloc(message, message_capacity);
+                if (!message) {
+                    fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+                    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                }
+            }
+            MPI_Recv(message, length, MPI_CHAR, 0, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            if (status.MPI_TAG == TAG_STOP) break;
+
+            double t0 = MPI_Wtime();
+            for (int offset = 0; offset < length; offset += strlen(message + offset) + 1) {
+                long long pixels = blur_image_file(message + offset, output_dir, kernel_size);
+                if (pixels > 0) {
+                    my_images++;
+                    my_pixels += pixels;
+                }
+            }
+            busy_time += MPI_Wtime() - t0;
+        }
+        free(message);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double elapsed_time = MPI_Wtime() - start_time;
+
+    // Per-rank throughput on root
+    double my_stats[3] = { (double)my_images, (double)my_pixels, busy_time };
+    double *all_stats = NULL;
+    if (rank == 0) {
+        all_stats = (double *)malloc(size * 3 * sizeof(double));
+        if (!all_stats) {
+            fprintf(stderr, "Memory allocation failed on root.\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+    }
+    MPI_Gather(my_stats, 3, MPI_DOUBLE, all_stats, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        long long total_images = 0, total_pixels = 0;
+        printf("\n=== Per-rank throughput ===\n");
+        printf("%-6s %10s %12s %12s %12s\n", "Rank", "Images", "Busy(s)", "Images/s", "Mpixels/s");
+        for (int i = 0; i < size; i++) {
+            double images = all_stats[i * 3], pixels = all_stats[i * 3 + 1], busy = all_stats[i * 3 + 2];
+            total_images += (long long)images;
+            total_pixels += (long long)pixels;
+            if (size > 1 && i == 0) {
+                printf("%-6d %10s %12s %12s %12s\n", i, "master", "-", "-", "-");
+                continue;
+            }
+            printf("%-6d %10.0f %12.6f %12.2f %12.2f\n", i, images, busy,
+                   busy > 0 ? images / busy : 0.0, busy > 0 ? pixels / (busy * 1000000) : 0.0);
+        }
+
+        printf("\n=== Results ===\n");
+        printf("Images: %lld of %d\n", total_images, num_names);
+        printf("Time: %.6f seconds\n", elapsed_time);
+        printf("Pixels: %lld\n", total_pixels);
+        printf("Throughput: %.2f images/sec\n", total_images / elapsed_time);
+        printf("Speed: %.2f Mpixels/sec\n\n", total_pixels / (elapsed_time * 1000000));
+
+        for (int i = 0; i < num_names; i++) free(names[i]);
+        free(names);
+        free(all_stats);
+    }
+}
+
+// Phases of the per-rank timing breakdown, in report order
+#define NUM_PHASES 7
+static const char *phase_names[NUM_PHASES] = { "barrier", "distribute", "decode", "halo", "compute", "gather", "io" };
+
+// Seconds this rank spent in each phase; the halo phase only counts time blocked on the exchange
+void rank_phases(const RankStats *stats, double phases[NUM_PHASES]) {
+    phases[0] = stats->barrier_time;
+    phases[1] = stats->distribute_time;
+    phases[2] = stats->decode_time;
+    phases[3] = stats->exposed_time;
+    phases[4] = stats->compute_time;
+    phases[5] = stats->gather_time;
+    phases[6] = stats->read_time + stats->write_time + stats->load_time + stats->save_time;
+}
+
+// Write the per-rank phase times (`size` rows of NUM_PHASES) and their min/avg/max summary.
+// A `.json` path gets JSON, anything else CSV. Returns 1 on success.
+int write_phase_timings(const char *filename, const double *all_phases, const double *min, const double *avg,
+                        const double *max, int size) {
+    FILE *f = fopen(filename, "w");
+    if (!f) return 0;
+
+    if (has_extension(filename, ".json")) {
+        fprintf(f, "{\n  \"ranks\": [\n");
+        for (int r = 0; r < size; r++) {
+            fprintf(f, "    {\"rank\": %d", r);
+            for (int p = 0; p < NUM_PHASES; p++) fprintf(f, ", \"%s\": %.9f", phase_names[p], all_phases[r * NUM_PHASES + p]);
+            fprintf(f, "}%s\n", r < size - 1 ? "," : "");
+        }
+        fprintf(f, "  ],\n  \"summary\": {\n");
+        for (int p = 0; p < NUM_PHASES; p++) {
+            fprintf(f, "    \"%s\": {\"min\": %.9f, \"avg\": %.9f, \"max\": %.9f}%s\n",
+                    phase_names[p], min[p], avg[p], max[p], p < NUM_PHASES - 1 ? "," : "");
+        }
+        fprintf(f, "  }\n}\n");
+    } else {
+        fprintf(f, "Rank");
+        for (int p = 0; p < NUM_PHASES; p++) fprintf(f, ",%s", phase_names[p]);
+        fprintf(f, "\n");
+        for (int r = 0; r < size; r++) {
+            fprintf(f, "%d", r);
+            for (int p = 0; p < NUM_PHASES; p++) fprintf(f, ",%.9f", all_phases[r * NUM_PHASES + p]);
+            fprintf(f, "\n");
+        }
+        const char *labels[3] = { "min", "avg", "max" };
+        const double *rows[3] = { min, avg, max };
+        for (int i = 0; i < 3; i++) {
+            fprintf(f, "%s", labels[i]);
+            for (int p = 0; p < NUM_PHASES; p++) fprintf(f, ",%.9f", rows[i][p]);
+            fprintf(f, "\n");
+        }
+    }
+
+    return fclose(f) == 0;
+}
+
 int main(int argc, char **argv) {
     int rank, size;
+#ifdef _OPENMP
+    // Only the master thread of each rank makes MPI calls
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+#else
     MPI_Init(&argc, &argv);
+#endif
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc != 3) {
+    // Optional flags follow the input and output paths
+    BlurOptions opts = { .overlap = 1, .iterations = 1, .frames = 1, .persistent = 1 };
+    int batch = 0, chunk = 1;
+    const char *timings_path = NULL;
+    int bad_args = (argc < 3);
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--no-overlap") == 0) opts.overlap = 0;
+        else if (strcmp(argv[i], "--calibrate") == 0) opts.calibrate = 1;
+        else if (strcmp(argv[i], "--bcast-compressed") == 0) opts.bcast_compressed = 1;
+        else if (strcmp(argv[i], "--shared") == 0) opts.shared_node = 1;
+        else if (strcmp(argv[i], "--deep-halo") == 0) opts.deep_halo = 1;
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            opts.iterations = atoi(argv[++i]);
+            if (opts.iterations < 1) bad_args = 1;
+        }
+        else if (strcmp(argv[i], "--no-persistent") == 0) opts.persistent = 0;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            opts.frames = atoi(argv[++i]);
+            if (opts.frames < 1) bad_args = 1;
+        }
+        else if (strcmp(argv[i], "--batch") == 0) batch = 1;
+        else if (strcmp(argv[i], "--timings") == 0 && i + 1 < argc) timings_path = argv[++i];
+        else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+            chunk = atoi(argv[++i]);
+            if (chunk < 1) bad_args = 1;
+        }
+        else if (strcmp(argv[i], "--decomp") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "2d") == 0) opts.decomp_2d = 1;
+            else if (strcmp(argv[i], "rows") != 0) bad_args = 1;
+        }
+        else bad_args = 1;
+    }
+    int iterated = (opts.iterations > 1 || opts.deep_halo);
+    int streamed = (opts.frames > 1);
+    if (opts.decomp_2d + opts.bcast_compressed + opts.shared_node + iterated + streamed > 1) bad_args = 1;
+    // Only the single-pass row slabs are sized by throughput
+    if (opts.calibrate && (opts.decomp_2d || opts.shared_node || iterated || streamed)) bad_args = 1;
+
+    if (bad_args) {
         if (rank == 0) {
             printf("Box Blur - MPI Distributed\n");
-            printf("Usage: mpirun -np 4 %s photo.jpg output.jpg\n", argv[0]);
+            printf("Usage: mpirun -np 4 %s photo.jpg output.jpg [--no-overlap] [--decomp rows|2d] [--calibrate]\n"
+                   "       [--bcast-compressed | --shared | --iterations N [--deep-halo] | --frames F [--no-persistent]]\n"
+                   "       [--timings FILE]\n", argv[0]);
+            printf("  --no-overlap   Exchange halos before computing instead of overlapping with interior rows\n");
+            printf("  --decomp 2d    Split the image into 2D blocks on a Cartesian process grid (default: row slabs)\n");
+            printf("  --calibrate    Size row slabs by each rank's measured throughput instead of equally\n"
+                   "                 (single-pass row slabs only)\n");
+            printf("  --bcast-compressed  Broadcast the encoded file and decode it on every rank (row slabs only)\n");
+            printf("  --shared       Ranks on a node share one input and one output buffer (MPI shared-memory windows)\n");
+            printf("  --iterations N Blur N times, exchanging halos before every pass\n");
+            printf("  --deep-halo    With --iterations: exchange one N-pass-deep halo once instead of one per pass\n");
+            printf("  --frames F     Benchmark: blur the image as F back-to-back frames with persistent halo requests\n");
+            printf("  --no-persistent  With --frames: set up buffers and halo requests again for every frame\n");
+            printf("  --timings FILE Write per-rank phase times and their min/avg/max as CSV (or JSON for a .json FILE)\n");
+            printf("Binary .pgm/.ppm input and .ppm output are read/written in parallel with MPI-IO (row slabs only).\n");
+            printf("\nBatch mode: mpirun -np 4 %s images.txt output_dir --batch [--chunk N]\n", argv[0]);
+            printf("  --batch        Blur every image listed in images.txt (one path per line) into output_dir\n");
+            printf("  --chunk N      File names handed to a worker per request (default: 1)\n");
         }
         MPI_Finalize();
         return EXIT_FAILURE;
     }
 
+    int kernel_size = 5;
+
+    if (batch) {
+        run_batch(argv[1], argv[2], chunk, kernel_size);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+
     unsigned char *input_rgb = NULL;
     unsigned char *output_rgb_root = NULL;
     int width = 0, height = 0, channels = 0;
-    int rows_per_process, start_row, end_row;
-    int kernel_size = 5;
-    double start_time, end_time;
+    long data_offset = 0;
+    unsigned char *encoded = NULL;
+    long encoded_size = 0;
+    int slab_io = !opts.decomp_2d && !opts.shared_node && !iterated && !streamed;
+    opts.mpiio_in = slab_io && !opts.bcast_compressed && (has_extension(argv[1], ".pgm") || has_extension(argv[1], ".ppm"));
+    opts.mpiio_out = slab_io && has_extension(argv[2], ".ppm");
 
-    // Root process loads the image
+    // Root process loads the image (or only its header when every rank reads its own slab)
+    RankStats stats = { 0 };
     if (rank == 0) {
         printf("=== MPI Box Blur ===\n");
         printf("Input: %s\n", argv[1]);
         printf("Output: %s\n", argv[2]);
         printf("Processes: %d\n", size);
+#ifdef _OPENMP
+        printf("Threads per process: %d\n", omp_get_max_threads());
+        if (provided < MPI_THREAD_FUNNELED) {
+            printf("Warning: MPI library does not provide MPI_THREAD_FUNNELED\n");
+        }
+#endif
+        printf("Decomposition: %s\n", opts.decomp_2d ? "2D blocks" :
+                                       opts.shared_node ? "row slabs per node (shared windows)" : "row slabs");
+        if (streamed) {
+            printf("Frames: %d (%s)\n", opts.frames,
+                   opts.persistent ? "persistent halo requests, reused buffers" : "per-frame setup");
+        } else if (iterated) {
+            printf("Iterations: %d (%s)\n", opts.iterations,
+                   opts.deep_halo ? "one deep halo exchange" : "halo exchange per pass");
+        } else if (!opts.decomp_2d && !opts.shared_node) {
+            printf("Halo exchange: %s\n", opts.overlap ? "overlapped with interior rows" : "blocking");
+        }
 
-        input_rgb = stbi_load(argv[1], &width, &height, &channels, 0);
-        if (input_rgb == NULL) {
-            fprintf(stderr, "Error: Cannot read %s\n", argv[1]);
-            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        double load_start = MPI_Wtime();
+        if (opts.mpiio_in) {
+            if (read_pnm_header(argv[1], &width, &height, &channels, &data_offset) != 0) {
+                fprintf(stderr, "Error: Cannot read %s\n", argv[1]);
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+        } else if (opts.bcast_compressed) {
+            // Only the header is parsed here; the pixels are decoded on every rank after the broadcast
+            encoded = read_file_bytes(argv[1], &encoded_size);
+            if (!encoded || !stbi_info_from_memory(encoded, encoded_size, &width, &height, &channels)) {
+                fprintf(stderr, "Error: Cannot read %s\n", argv[1]);
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+        } else {
+            input_rgb = stbi_load(argv[1], &width, &height, &channels, 0);
+            if (input_rgb == NULL) {
+                fprintf(stderr, "Error: Cannot read %s\n", argv[1]);
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
         }
-        
+
+        stats.load_time = MPI_Wtime() - load_start;
         printf("Loaded: %dx%d, %d channel(s)\n", width, height, channels);
-        
+
         printf("Kernel: %dx%d box blur\n", kernel_size, kernel_size);
         printf("\nProcessing...\n");
     }
@@ -82,97 +1510,173 @@ int main(int argc, char **argv) {
     MPI_Bcast(&width, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&height, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&channels, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&data_offset, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&encoded_size, 1, MPI_LONG, 0, MPI_COMM_WORLD);
 
-    // Calculate rows per process
-    rows_per_process = height / size;
-    start_row = rank * rows_per_process;
-    end_row = (rank == size - 1) ? height : start_row + rows_per_process;
-    int my_rows = end_row - start_row;
-
-    // Allocate buffers for non-root processes
-    if (rank != 0) {
-        input_rgb = (unsigned char*)malloc(width * height * channels);
-        if (!input_rgb) {
-            fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
+    if (rank == 0 && !opts.mpiio_out) {
+        output_rgb_root = (unsigned char*)malloc((size_t)width * height * 3);
+        if (!output_rgb_root) {
+            fprintf(stderr, "Memory allocation failed on root.\n");
             MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
         }
     }
 
+    if (opts.decomp_2d) {
+        blur_2d_blocks(input_rgb, output_rgb_root, width, height, channels, kernel_size, &stats);
+    } else if (streamed) {
+        blur_frames(input_rgb, output_rgb_root, width, height, channels, kernel_size,
+                    opts.frames, opts.persistent, &stats);
+    } else if (iterated) {
+        blur_iterated_slabs(input_rgb, output_rgb_root, width, height, channels, kernel_size,
+                            opts.iterations, opts.deep_halo, &stats);
+    } else if (opts.shared_node) {
+        blur_shared_nodes(input_rgb, output_rgb_root, width, height, channels, kernel_size, &stats);
+    } else {
+        blur_row_slabs(input_rgb, output_rgb_root, width, height, channels, kernel_size, data_offset,
+                       encoded, (size_t)encoded_size, argv[1], argv[2], &opts, &stats);
+    }
+
+    // Root saves the output (an MPI-IO output has already been written by every rank)
+    if (rank == 0 && !opts.mpiio_out) {
+        double save_start = MPI_Wtime();
+        stats.write_ok = write_output(argv[2], output_rgb_root, width, height);
+        stats.save_time = MPI_Wtime() - save_start;
+    }
+
+    // Per-rank phase breakdown: every rank's row on root, plus min/avg/max over the ranks
+    double my_phases[NUM_PHASES], min_phases[NUM_PHASES], max_phases[NUM_PHASES], avg_phases[NUM_PHASES];
+    rank_phases(&stats, my_phases);
+    double *all_phases = NULL;
     if (rank == 0) {
-        output_rgb_root = (unsigned char*)malloc(width * height * 3);
-        if (!output_rgb_root) {
+        all_phases = (double *)malloc(size * NUM_PHASES * sizeof(double));
+        if (!all_phases) {
             fprintf(stderr, "Memory allocation failed on root.\n");
             MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
         }
     }
-
-    unsigned char *my_output = (unsigned char*)malloc(width * my_rows * 3);
-    if (!my_output) {
-        fprintf(stderr, "Memory allocation failed on rank %d.\n", rank);
-        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    MPI_Gather(my_phases, NUM_PHASES, MPI_DOUBLE, all_phases, NUM_PHASES, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Reduce(my_phases, min_phases, NUM_PHASES, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(my_phases, max_phases, NUM_PHASES, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(my_phases, avg_phases, NUM_PHASES, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        for (int p = 0; p < NUM_PHASES; p++) avg_phases[p] /= size;
     }
 
-    // Start timing after setup
-    MPI_Barrier(MPI_COMM_WORLD);
-    start_time = MPI_Wtime();
-
-    // Broadcast entire image to all processes
-    MPI_Bcast(input_rgb, width * height * channels, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-
-    // Each process works on its assigned rows
-    apply_box_blur_mpi(input_rgb, my_output, width, height, channels, kernel_size, start_row, end_row);
-
-    // Gather results back to root
-    int *recv_counts = NULL;
-    int *displs = NULL;
-    
+    // Collect the per-rank halo timings on root
+    double my_timing[3] = { stats.halo_time, stats.exposed_time, stats.compute_time };
+    double *all_timings = NULL;
     if (rank == 0) {
-        recv_counts = (int *)malloc(size * sizeof(int));
-        displs = (int *)malloc(size * sizeof(int));
-        
-        for (int i = 0; i < size; i++) {
-            int i_start = i * rows_per_process;
-            int i_end = (i == size - 1) ? height : i_start + rows_per_process;
-            recv_counts[i] = (i_end - i_start) * width * 3;
-            displs[i] = i_start * width * 3;
+        all_timings = (double *)malloc(size * 3 * sizeof(double));
+        if (!all_timings) {
+            fprintf(stderr, "Memory allocation failed on root.\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
         }
     }
+    MPI_Gather(my_timing, 3, MPI_DOUBLE, all_timings, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
-    MPI_Gatherv(my_output, my_rows * width * 3, MPI_UNSIGNED_CHAR,
-                output_rgb_root, recv_counts, displs, MPI_UNSIGNED_CHAR,
-                0, MPI_COMM_WORLD);
-
-    // End timing
-    MPI_Barrier(MPI_COMM_WORLD);
-    end_time = MPI_Wtime();
+    // Aggregate I/O bandwidth: total bytes over the slowest rank's time
+    double max_read_time, max_write_time, max_distribute_time, max_decode_time;
+    long long total_read_bytes, total_write_bytes, total_halo_bytes, total_distribute_bytes;
+    int all_write_ok;
+    MPI_Reduce(&stats.read_time, &max_read_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.write_time, &max_write_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.read_bytes, &total_read_bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.write_bytes, &total_write_bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.halo_bytes, &total_halo_bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.distribute_time, &max_distribute_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.decode_time, &max_decode_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.distribute_bytes, &total_distribute_bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.write_ok, &all_write_ok, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+    int num_nodes, max_halo_rounds;
+    MPI_Reduce(&stats.halo_rounds, &max_halo_rounds, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    long long total_window_bytes, total_slab_bytes;
+    MPI_Reduce(&stats.node_leader, &num_nodes, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.window_bytes, &total_window_bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&stats.slab_bytes, &total_slab_bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 
-    // Root process saves the output
+    // Root process reports the results
     if (rank == 0) {
-        double elapsed_time = end_time - start_time;
-        
-        // Auto-detect output format
-        int ok = 0;
-        if (strstr(argv[2], ".png")) ok = stbi_write_png(argv[2], width, height, 3, output_rgb_root, width*3);
-        else if (strstr(argv[2], ".jpg")) ok = stbi_write_jpg(argv[2], width, height, 3, output_rgb_root, 90);
-        else ok = stbi_write_bmp(argv[2], width, height, 3, output_rgb_root);
-        
-        if (!ok) {
+        double elapsed_time = stats.elapsed;
+
+        if (!all_write_ok) {
             fprintf(stderr, "Error writing output\n");
         } else {
             printf("\n=== Results ===\n");
             printf("Time: %.6f seconds\n", elapsed_time);
-            printf("Pixels: %d\n", width * height);
-            printf("Speed: %.2f Mpixels/sec\n\n", (width * height) / (elapsed_time * 1000000));
+            printf("Pixels: %lld\n", (long long)width * height * opts.frames);
+            printf("Speed: %.2f Mpixels/sec\n", ((double)width * height * opts.frames) / (elapsed_time * 1000000));
+            if (streamed) {
+                printf("Frames: %d (%.6f seconds/frame, %.2f frames/sec)\n", opts.frames,
+                       elapsed_time / opts.frames, opts.frames / elapsed_time);
+            }
+            printf("\n");
+
+            if (opts.bcast_compressed) {
+                printf("Input distribution: %.2f MB encoded file broadcast in %.6f seconds, decoded in %.6f seconds\n",
+                       total_distribute_bytes / 1e6, max_distribute_time, max_decode_time);
+                printf("Decoded image: %.2f MB (%.1fx the encoded file)\n",
+                       (double)width * height * channels / 1e6, (double)width * height * channels / encoded_size);
+            } else if (opts.shared_node) {
+                printf("Input distribution: %.2f MB of pixels scattered to %d node leader(s) in %.6f seconds\n",
+                       total_distribute_bytes / 1e6, num_nodes, max_distribute_time);
+                printf("Buffer memory: %.2f MB in shared windows (private slabs: %.2f MB)\n",
+                       total_window_bytes / 1e6, total_slab_bytes / 1e6);
+            } else if (!opts.mpiio_in && !opts.decomp_2d) {
+                printf("Input distribution: %.2f MB of pixels scattered in %.6f seconds\n",
+                       total_distribute_bytes / 1e6, max_distribute_time);
+            }
+            if (opts.mpiio_in) {
+                printf("MPI-IO read: %.2f MB in %.6f seconds (%.2f MB/s aggregate)\n",
+                       total_read_bytes / 1e6, max_read_time, total_read_bytes / (max_read_time * 1e6));
+            }
+            if (opts.mpiio_out) {
+                printf("MPI-IO write: %.2f MB in %.6f seconds (%.2f MB/s aggregate)\n",
+                       total_write_bytes / 1e6, max_write_time, total_write_bytes / (max_write_time * 1e6));
+            }
+
+            if (iterated) {
+                printf("Halo exchanges: %d round(s) of %d row(s) for %d pass(es)\n", max_halo_rounds,
+                       opts.deep_halo ? opts.iterations * (kernel_size / 2) : kernel_size / 2, opts.iterations);
+            }
+
+            // Row slabs exchange 2 * (P - 1) full-width strips of kernel_size / 2 rows
+            long long row_slab_bytes = 2LL * (size - 1) * (kernel_size / 2) * width * channels;
+            printf("Halo volume: %.3f MB (row slabs: %.3f MB)\n\n", total_halo_bytes / 1e6, row_slab_bytes / 1e6);
+
+            printf("=== Per-rank halo exchange ===\n");
+            printf("%-6s %12s %12s %12s %12s\n", "Rank", "Halo(s)", "Hidden(s)", "Exposed(s)", "Compute(s)");
+            double max_compute = 0.0, sum_compute = 0.0;
+            for (int i = 0; i < size; i++) {
+                double halo = all_timings[i * 3], exposed = all_timings[i * 3 + 1], compute = all_timings[i * 3 + 2];
+                printf("%-6d %12.6f %12.6f %12.6f %12.6f\n", i, halo, halo - exposed, exposed, compute);
+                if (compute > max_compute) max_compute = compute;
+                sum_compute += compute;
+            }
+            printf("Load imbalance (max/avg compute): %.3f\n\n", sum_compute > 0.0 ? max_compute / (sum_compute / size) : 1.0);
+
+            printf("=== Phase breakdown (seconds over %d rank(s)) ===\n", size);
+            printf("%-12s %12s %12s %12s\n", "Phase", "Min", "Avg", "Max");
+            for (int p = 0; p < NUM_PHASES; p++) {
+                printf("%-12s %12.6f %12.6f %12.6f\n", phase_names[p], min_phases[p], avg_phases[p], max_phases[p]);
+            }
+            printf("\n");
+
+            if (timings_path) {
+                if (write_phase_timings(timings_path, all_phases, min_phases, avg_phases, max_phases, size)) {
+                    printf("Phase timings saved to %s\n", timings_path);
+                } else {
+                    fprintf(stderr, "Error: Cannot write %s\n", timings_path);
+                }
+            }
         }
 
+        stbi_image_free(input_rgb);
+        free(encoded);
         free(output_rgb_root);
-        free(recv_counts);
-        free(displs);
+        free(all_timings);
+        free(all_phases);
     }
-    
-    free(input_rgb);
-    free(my_output);
-    
+
     MPI_Finalize();
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
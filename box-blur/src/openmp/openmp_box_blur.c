@@ -24,7 +24,7 @@ void apply_box_blur_openmp(const unsigned char *input, unsigned char *output_rgb
                         int ny = y + m;
 
                         if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
-                            int src_idx = (ny * width + nx) * channels + (channels == 1 ? 0 : c);
+                            int src_idx = (ny * width + nx) * channels + (channels < 3 ? 0 : c);
                             sum += input[src_idx];
                             count++;
                         }
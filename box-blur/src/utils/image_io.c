@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "image_io.h"
 
 // BMP file header structures
@@ -156,3 +158,95 @@ int write_image(const char* filename, unsigned char* image, int width, int heigh
     fclose(file);
     return 0;
 }
+
+// Read the next integer from a PNM header, skipping whitespace and '#' comments
+static int read_pnm_value(FILE *file, int *value) {
+    int ch = fgetc(file);
+    while (ch != EOF) {
+        if (ch == '#') {
+            while (ch != EOF && ch != '\n') ch = fgetc(file);
+        } else if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n') {
+            ch = fgetc(file);
+        } else {
+            break;
+        }
+    }
+    if (ch < '0' || ch > '9') return -1;
+
+    *value = 0;
+    while (ch >= '0' && ch <= '9') {
+        if (*value > (INT_MAX - (ch - '0')) / 10) return -1;
+        *value = *value * 10 + (ch - '0');
+        ch = fgetc(file);
+    }
+    // Exactly one whitespace character follows the last header value
+    return (ch == EOF) ? -1 : 0;
+}
+
+// Parse binary PGM (P5) / PPM (P6) header
+int read_pnm_header(const char* filename, int* width, int* height, int* channels, long* data_offset) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open file: %s\n", filename);
+        return -1;
+    }
+
+    char magic[2];
+    int maxval;
+    if (fread(magic, 1, 2, file) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6')) {
+        fprintf(stderr, "Not a binary PGM/PPM file: %s\n", filename);
+        fclose(file);
+        return -1;
+    }
+
+    if (read_pnm_value(file, width) != 0 || read_pnm_value(file, height) != 0 ||
+        read_pnm_value(file, &maxval) != 0) {
+        fprintf(stderr, "Error reading PGM/PPM header\n");
+        fclose(file);
+        return -1;
+    }
+
+    if (maxval != 255) {
+        fprintf(stderr, "Only 8-bit PGM/PPM supported (maxval %d)\n", maxval);
+        fclose(file);
+        return -1;
+    }
+
+    *channels = (magic[1] == '5') ? 1 : 3;
+    if (*width <= 0 || *height <= 0 || *width > INT_MAX / *channels || *height > INT_MAX / *channels) {
+        fprintf(stderr, "Invalid PGM/PPM dimensions %dx%d\n", *width, *height);
+        fclose(file);
+        return -1;
+    }
+    *data_offset = ftell(file);
+    fclose(file);
+
+    // The pixel data must all be there, or the readers would blur uninitialised memory
+    struct stat st;
+    long long data_bytes = (long long)*width * *height * *channels;
+    if (stat(filename, &st) != 0 || (long long)st.st_size - *data_offset < data_bytes) {
+        fprintf(stderr, "Truncated PGM/PPM file: %s (expected %lld bytes of pixel data)\n", filename, data_bytes);
+        return -1;
+    }
+    return 0;
+}
+
+// Write binary PPM (P6) image
+int write_ppm(const char* filename, const unsigned char* rgb, int width, int height) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "Cannot create file: %s\n", filename);
+        return -1;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    size_t pixel_bytes = (size_t)width * height * 3;
+    if (fwrite(rgb, 1, pixel_bytes, file) != pixel_bytes) {
+        fprintf(stderr, "Error writing image data\n");
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+    return 0;
+}
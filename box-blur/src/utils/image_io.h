@@ -9,4 +9,11 @@ unsigned char* read_image(const char* filename, int* width, int* height);
 // Write BMP grayscale image file
 int write_image(const char* filename, unsigned char* image, int width, int height);
 
+// Parse the header of a binary PGM (P5) or PPM (P6) file with maxval 255.
+// Returns 0 on success and the byte offset where the pixel data starts.
+int read_pnm_header(const char* filename, int* width, int* height, int* channels, long* data_offset);
+
+// Write binary PPM (P6) image file from 3-channel RGB pixels
+int write_ppm(const char* filename, const unsigned char* rgb, int width, int height);
+
 #endif // IMAGE_IO_H
\ No newline at end of file